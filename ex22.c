@@ -4,6 +4,7 @@
 #include <unistd.h>
 #define _GNU_SOURCE
 #include <dirent.h>
+#include <fnmatch.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <errno.h>
@@ -20,41 +21,296 @@
 #define WRONG 5
 #define SIMILAR 6
 
+#define MAX_ASSIGNMENTS 16
+#define MAX_TESTS 16
+
+#define METRICS_FILE "metrics.prom"
+#define METRICS_INTERVAL_SEC 5
+#define PHASE_COMPILE 0
+#define PHASE_RUN 1
+#define PHASE_COMPARE 2
+#define PHASE_COUNT 3
+
+#define JOURNAL_FILE "grading.journal"
+#define JOURNAL_SYNC_EVERY 16
+#define MAX_NAME_LENGTH 256
+
+static const char *verdictNames[] = {"", "NO_C_FILE", "COMPILATION_ERROR", "TIMEOUT", "EXCELLENT", "WRONG", "SIMILAR"};
+static const char *phaseNames[PHASE_COUNT] = {"compile", "run", "compare"};
+
+static const int defaultScores[] = {0, 0, 10, 20, 100, 50, 75};
+
+/**
+ * One assignment of a batch: which source file to grade in each submission,
+ * the tests to run it on, its scoring table and where its results are written.
+ */
+typedef struct {
+    char name[MAX_LINE_LENGTH];
+    char pattern[MAX_LINE_LENGTH];
+    char inputs[MAX_TESTS][MAX_LINE_LENGTH];
+    char outputs[MAX_TESTS][MAX_LINE_LENGTH];
+    int testCount;
+    int scores[SIMILAR + 1];
+    char resultsPath[MAX_LINE_LENGTH * 2];
+    int fd;
+} Assignment;
+
+/**
+ * One graded submission of an assignment, as recorded in the journal.
+ */
+typedef struct {
+    int assignment;
+    int verdict;
+    long long sourceTime;
+    long long sourceSize;
+    char submission[MAX_NAME_LENGTH];
+} JournalEntry;
+
+/**
+ * Append-only record of the submissions graded in the current batch.
+ * Entries loaded from an interrupted run are kept sorted for lookup.
+ */
+static struct {
+    char path[MAX_LINE_LENGTH * 2];
+    int fd;
+    int unsynced;
+    JournalEntry *entries;
+    int count;
+} journal = {.fd = -1};
+
+/**
+ * Growable list of latency samples (in seconds) for one grading phase.
+ */
+typedef struct {
+    double *samples;
+    int count;
+    int capacity;
+    double sum;
+} LatencySamples;
+
+/**
+ * Live counters of the current batch, periodically exported to METRICS_FILE.
+ */
+static struct {
+    char path[MAX_LINE_LENGTH * 2];
+    char tmpPath[MAX_LINE_LENGTH * 2];
+    int total;
+    int processed;
+    int replayed;
+    int inFlight;
+    int verdicts[SIMILAR + 1];
+    LatencySamples phases[PHASE_COUNT];
+    double start;
+    double lastFlush;
+} metrics;
+
+/**
+ * Returns the current wall clock time in seconds.
+ */
+double nowSeconds() {
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) == -1) {
+        perror("Error in: gettimeofday");
+        return 0;
+    }
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Sets the metrics file path (inside dirPath) and starts the batch clock.
+ *
+ * @param dirPath The absolute directory the metrics file is written to.
+ */
+void initMetrics(char *dirPath) {
+    snprintf(metrics.path, sizeof(metrics.path), "%s/%s", dirPath, METRICS_FILE);
+    snprintf(metrics.tmpPath, sizeof(metrics.tmpPath), "%s/%s.tmp", dirPath, METRICS_FILE);
+    metrics.start = nowSeconds();
+    metrics.lastFlush = metrics.start;
+}
+
+/**
+ * Records how long one phase of grade() took.
+ *
+ * @param phase One of PHASE_COMPILE, PHASE_RUN or PHASE_COMPARE.
+ * @param seconds The duration of the phase.
+ */
+void recordPhase(int phase, double seconds) {
+    LatencySamples *ls = &metrics.phases[phase];
+    if (ls->count == ls->capacity) {
+        int capacity = ls->capacity == 0 ? 64 : ls->capacity * 2;
+        double *samples = realloc(ls->samples, capacity * sizeof(double));
+        if (samples == NULL) {
+            perror("Error in: realloc");
+            return;
+        }
+        ls->samples = samples;
+        ls->capacity = capacity;
+    }
+    ls->samples[ls->count++] = seconds;
+    ls->sum += seconds;
+}
+
+/**
+ * qsort comparator for doubles in ascending order.
+ */
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Returns the nearest-rank quantile of an already sorted array.
+ */
+double quantile(double *sorted, int count, double q) {
+    int rank;
+    if (count == 0) {
+        return 0;
+    }
+    rank = (int)(q * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+/**
+ * Writes the current metrics in Prometheus text exposition format.
+ * The file is written under a temporary name and renamed over METRICS_FILE,
+ * so a scraper never sees a partially written file.
+ */
+void writeMetrics() {
+    char buf[8192];
+    int len = 0, i, p;
+    double now = nowSeconds();
+    double elapsed = now - metrics.start;
+    metrics.lastFlush = now;
+
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "# HELP grader_submissions_processed_total Submissions graded so far.\n"
+                    "# TYPE grader_submissions_processed_total counter\n"
+                    "grader_submissions_processed_total %d\n"
+                    "# HELP grader_submissions_pending Submissions not graded yet.\n"
+                    "# TYPE grader_submissions_pending gauge\n"
+                    "grader_submissions_pending %d\n"
+                    "# HELP grader_submissions_replayed_total Submissions copied from the journal of an interrupted run.\n"
+                    "# TYPE grader_submissions_replayed_total counter\n"
+                    "grader_submissions_replayed_total %d\n"
+                    "# HELP grader_submissions_per_second Average grading throughput of this run, without replayed submissions.\n"
+                    "# TYPE grader_submissions_per_second gauge\n"
+                    "grader_submissions_per_second %.3f\n"
+                    "# HELP grader_children_in_flight Child processes currently running.\n"
+                    "# TYPE grader_children_in_flight gauge\n"
+                    "grader_children_in_flight %d\n"
+                    "# HELP grader_verdicts_total Submissions per verdict.\n"
+                    "# TYPE grader_verdicts_total counter\n",
+                    metrics.processed, metrics.total - metrics.processed, metrics.replayed,
+                    elapsed > 0 ? (metrics.processed - metrics.replayed) / elapsed : 0.0, metrics.inFlight);
+    for (i = NO_C_FILE; i <= SIMILAR; i++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "grader_verdicts_total{verdict=\"%s\"} %d\n",
+                        verdictNames[i], metrics.verdicts[i]);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "# HELP grader_phase_latency_seconds Duration of the grading phases.\n"
+                    "# TYPE grader_phase_latency_seconds summary\n");
+    for (p = 0; p < PHASE_COUNT; p++) {
+        LatencySamples *ls = &metrics.phases[p];
+        double *sorted = NULL;
+        if (ls->count > 0) {
+            sorted = malloc(ls->count * sizeof(double));
+            if (sorted == NULL) {
+                perror("Error in: malloc");
+                return;
+            }
+            memcpy(sorted, ls->samples, ls->count * sizeof(double));
+            qsort(sorted, ls->count, sizeof(double), compareDoubles);
+        }
+        len += snprintf(buf + len, sizeof(buf) - len,
+                        "grader_phase_latency_seconds{phase=\"%s\",quantile=\"0.5\"} %.6f\n"
+                        "grader_phase_latency_seconds{phase=\"%s\",quantile=\"0.95\"} %.6f\n"
+                        "grader_phase_latency_seconds{phase=\"%s\",quantile=\"0.99\"} %.6f\n"
+                        "grader_phase_latency_seconds_sum{phase=\"%s\"} %.6f\n"
+                        "grader_phase_latency_seconds_count{phase=\"%s\"} %d\n",
+                        phaseNames[p], quantile(sorted, ls->count, 0.5),
+                        phaseNames[p], quantile(sorted, ls->count, 0.95),
+                        phaseNames[p], quantile(sorted, ls->count, 0.99),
+                        phaseNames[p], ls->sum, phaseNames[p], ls->count);
+        free(sorted);
+    }
+
+    int fd = open(metrics.tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Error in: open");
+        return;
+    }
+    if (write(fd, buf, len) != len) {
+        perror("Error in: write");
+    }
+    if (close(fd) == -1) {
+        perror("Error in: close");
+    }
+    if (rename(metrics.tmpPath, metrics.path) == -1) {
+        perror("Error in: rename");
+    }
+}
+
+/**
+ * Rewrites the metrics file if METRICS_INTERVAL_SEC passed since the last write.
+ */
+void maybeWriteMetrics() {
+    if (nowSeconds() - metrics.lastFlush >= METRICS_INTERVAL_SEC) {
+        writeMetrics();
+    }
+}
+
+/**
+ * Waits for a child process like waitpid, rewriting the metrics file while it runs.
+ *
+ * @return The child pid, or -1 on error.
+ */
+pid_t waitChild(pid_t pid, int *status) {
+    pid_t res;
+    while ((res = waitpid(pid, status, WNOHANG)) == 0) {
+        maybeWriteMetrics();
+        usleep(1000);
+    }
+    return res;
+}
+
 /**
 
 * Writes a line to a file descriptor representing a CSV row with the results of a program.
 * The line consists of three fields: the first is always empty, the second is a score value
-* according to the program result, and the third is a description of the program result.
+* taken from the assignment scoring table, and the third is a description of the program result.
 *
 * @param option An integer representing the program result, according to a predefined set of options.
-* @param fd The file descriptor to write the CSV line to.
+* @param assignment The assignment whose scoring table and results file are used.
 */
-void writeToFile(int option, int fd)
+void writeToFile(int option, Assignment *assignment)
 {
-    // printing to results.csv the correct option
-    switch (option) {
-    case NO_C_FILE:
-        write(fd, ",0,NO_C_FILE\n", 13);
-        break;
-    case COMPILATION_ERROR:
-        write(fd, ",10,COMPILATION_ERROR\n", 22);
-        break;
-    case TIMEOUT:
-        write(fd, ",20,TIMEOUT\n", 12);
-        break;
-    case EXCELLENT:
-        write(fd, ",100,EXCELLENT\n", 15);
-        break;
-    case WRONG:
-        write(fd, ",50,WRONG\n", 10);
-        break;
-    case SIMILAR:
-        write(fd, ",75,SIMILAR\n", 12);
-        break;
-    default:
-        write(fd, "Invalid option selected\n", 24);
-        break;
+    char line[MAX_LINE_LENGTH];
+    int len;
+    if (option < NO_C_FILE || option > SIMILAR) {
+        write(assignment->fd, "Invalid option selected\n", 24);
+        return;
     }
+    metrics.verdicts[option]++;
+    // printing to the results file the correct option
+    len = snprintf(line, sizeof(line), ",%d,%s\n", assignment->scores[option], verdictNames[option]);
+    write(assignment->fd, line, len);
+}
+
+/**
+ * Writes a CSV row ending for a submission that could not be graded. The row has
+ * no score and is not counted as a verdict.
+ *
+ * @param reason A short description of the failure, e.g. "COMPARE_ERROR".
+ * @param assignment The assignment whose results file is written.
+ */
+void writeErrorRow(char *reason, Assignment *assignment) {
+    char line[MAX_LINE_LENGTH];
+    int len = snprintf(line, sizeof(line), ",,%s\n", reason);
+    write(assignment->fd, line, len);
 }
 
 /**
@@ -118,6 +374,30 @@ int checkUserPathes(char strings[3][MAX_LINE_LENGTH]) {
     return 1;
 }
 
+/**
+ * Reads one line from a file descriptor, without the trailing newline.
+ *
+ * @param fd The file descriptor to read from.
+ * @param line A buffer of MAX_LINE_LENGTH chars that receives the line.
+ * @return 1 if a line was read, 0 on end of file.
+ */
+int readLine(int fd, char *line) {
+    int n = 0, got = 0;
+    char c;
+    while (n < MAX_LINE_LENGTH - 1 && read(fd, &c, 1) > 0) {
+        got = 1;
+        if (c == '\n') {
+            break;
+        }
+        line[n++] = c;
+    }
+    if (n > 0 && line[n - 1] == '\r') {
+        n--;
+    }
+    line[n] = '\0';
+    return got;
+}
+
 /**
  * Reads the contents of a file and returns an array of strings containing
  * the first three lines of the file.
@@ -134,38 +414,444 @@ void read_file(char *filename, char strings[3][MAX_LINE_LENGTH]) {
         perror("Error in: open");
         exit(-1);
     }
-    // Read the first line of the file and store it in the first string.
-    int n = 0;
-    char c;
-    while (n < MAX_LINE_LENGTH && read(fd, &c, 1) > 0) {
-        if (c == '\n') {
-            break;
+    // Read the directory, input and output lines.
+    int i;
+    for (i = 0; i < 3; i++) {
+        if (readLine(fd, strings[i]) == 0) {
+            strings[i][0] = '\0';
         }
-        strings[0][n++] = c;
     }
-    strings[0][n] = '\0';
-    // Read the second line of the file and store it in the second string.
-    n = 0;
-    while (n < MAX_LINE_LENGTH && read(fd, &c, 1) > 0) {
-        if (c == '\n') {
+    // Close the file.
+    if(close(fd) == -1){
+        perror("Error in: close");
+    }
+}
+
+/**
+ * Sets the default values of an assignment: every ".c" file matches,
+ * the scores from the README and results written to results_<name>.csv.
+ *
+ * @param assignment The assignment to initialize.
+ * @param name The assignment name.
+ * @param cwd The directory the results file is created in.
+ */
+void initAssignment(Assignment *assignment, char *name, char *cwd) {
+    memset(assignment, 0, sizeof(*assignment));
+    snprintf(assignment->name, MAX_LINE_LENGTH, "%s", name);
+    strcpy(assignment->pattern, "*.c");
+    memcpy(assignment->scores, defaultScores, sizeof(defaultScores));
+    snprintf(assignment->resultsPath, MAX_LINE_LENGTH * 2, "%s/results_%s.csv", cwd, name);
+    assignment->fd = -1;
+}
+
+/**
+ * Splits a batch config line into a keyword and up to two values.
+ *
+ * @return The number of fields found, or 0 for blank and "#" comment lines.
+ */
+int parseConfigLine(char *line, char *key, char *first, char *second) {
+    int fields = sscanf(line, "%199s %199s %199s", key, first, second);
+    if (fields <= 0 || key[0] == '#') {
+        return 0;
+    }
+    return fields;
+}
+
+/**
+ * Checks whether a config file is in the batch format, i.e. the first line after
+ * the submissions directory that is not blank or a comment is an "assignment" line.
+ *
+ * @param filename The config file.
+ * @return 1 for the batch format, 0 for the legacy three lines format.
+ */
+int isBatchConfig(char *filename) {
+    char line[MAX_LINE_LENGTH];
+    char key[MAX_LINE_LENGTH], first[MAX_LINE_LENGTH], second[MAX_LINE_LENGTH];
+    int batch = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("Error in: open");
+        exit(-1);
+    }
+    readLine(fd, line);
+    while (readLine(fd, line)) {
+        if (parseConfigLine(line, key, first, second) > 0) {
+            batch = strcmp(key, "assignment") == 0;
             break;
         }
-        strings[1][n++] = c;
     }
-    strings[1][n] = '\0';
-    // Read the third line of the file and store it in the third string.
-    n = 0;
-    while (n < MAX_LINE_LENGTH && read(fd, &c, 1) > 0) {
-        if (c == '\n') {
+    if (close(fd) == -1) {
+        perror("Error in: close");
+    }
+    return batch;
+}
+
+/**
+ * Reads a configuration file and fills the submissions directory and the assignments to grade.
+ *
+ * The legacy format is three lines: the submissions directory, the input file and
+ * the expected output file; it is graded as one assignment written to results.csv.
+ * The batch format starts with the submissions directory followed by one block per assignment:
+ *
+ *     assignment <name>
+ *     source <pattern>             (default "*.c")
+ *     test <input> <expected>      (at least one, up to MAX_TESTS)
+ *     score <VERDICT> <points>     (optional, e.g. "score SIMILAR 80")
+ *     results <file>               (default results_<name>.csv)
+ *
+ * All the paths are checked and made absolute.
+ *
+ * @param filename The configuration file.
+ * @param dirName A buffer of MAX_LINE_LENGTH chars that receives the submissions directory.
+ * @param assignments An array of MAX_ASSIGNMENTS assignments to fill.
+ * @param cwd The directory results files are created in.
+ * @return The number of assignments, or 0 if the configuration is not valid.
+ */
+int loadConfig(char *filename, char *dirName, Assignment *assignments, char *cwd) {
+    char strings[3][MAX_LINE_LENGTH];
+    char line[MAX_LINE_LENGTH];
+    char key[MAX_LINE_LENGTH], first[MAX_LINE_LENGTH], second[MAX_LINE_LENGTH];
+    int count = 0, i, t, points;
+    Assignment *current = NULL;
+
+    if (!isBatchConfig(filename)) {
+        // legacy three lines config
+        read_file(filename, strings);
+        if (checkUserPathes(strings) == 0) {
+            return 0;
+        }
+        strcpy(dirName, strings[0]);
+        initAssignment(&assignments[0], "results", cwd);
+        snprintf(assignments[0].resultsPath, MAX_LINE_LENGTH * 2, "%s/%s", cwd, "results.csv");
+        strcpy(assignments[0].inputs[0], strings[1]);
+        strcpy(assignments[0].outputs[0], strings[2]);
+        assignments[0].testCount = 1;
+        return 1;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("Error in: open");
+        exit(-1);
+    }
+    readLine(fd, dirName);
+    while (readLine(fd, line)) {
+        int fields = parseConfigLine(line, key, first, second);
+        if (fields == 0) {
+            continue;
+        }
+        if (strcmp(key, "assignment") == 0 && fields == 2) {
+            if (count == MAX_ASSIGNMENTS) {
+                write(STDERR_FILENO, "Too many assignments\n", strlen("Too many assignments\n"));
+                count = 0;
+                break;
+            }
+            current = &assignments[count++];
+            initAssignment(current, first, cwd);
+        }
+        else if (current == NULL) {
+            write(STDERR_FILENO, "Config line before assignment\n", strlen("Config line before assignment\n"));
+            count = 0;
+            break;
+        }
+        else if (strcmp(key, "source") == 0 && fields == 2) {
+            strcpy(current->pattern, first);
+        }
+        else if (strcmp(key, "test") == 0 && fields == 3 && current->testCount < MAX_TESTS) {
+            strcpy(current->inputs[current->testCount], first);
+            strcpy(current->outputs[current->testCount], second);
+            current->testCount++;
+        }
+        else if (strcmp(key, "score") == 0 && fields == 3 && sscanf(second, "%d", &points) == 1) {
+            for (i = NO_C_FILE; i <= SIMILAR && strcmp(verdictNames[i], first) != 0; i++);
+            if (i > SIMILAR) {
+                write(STDERR_FILENO, "Unknown verdict in score\n", strlen("Unknown verdict in score\n"));
+                count = 0;
+                break;
+            }
+            current->scores[i] = points;
+        }
+        else if (strcmp(key, "results") == 0 && fields == 2) {
+            if (first[0] == '/') {
+                snprintf(current->resultsPath, MAX_LINE_LENGTH * 2, "%s", first);
+            }
+            else {
+                snprintf(current->resultsPath, MAX_LINE_LENGTH * 2, "%s/%s", cwd, first);
+            }
+        }
+        else {
+            write(STDERR_FILENO, "Invalid config line: ", strlen("Invalid config line: "));
+            write(STDERR_FILENO, line, strlen(line));
+            write(STDERR_FILENO, "\n", 1);
+            count = 0;
             break;
         }
-        strings[2][n++] = c;
     }
-    strings[2][n] = '\0';
-    // Close the file.
-    if(close(fd) == -1){
+    if (close(fd) == -1) {
         perror("Error in: close");
     }
+    // two assignments writing the same results file would corrupt it
+    for (i = 0; i < count; i++) {
+        for (t = i + 1; t < count; t++) {
+            if (strcmp(assignments[i].name, assignments[t].name) == 0) {
+                write(STDERR_FILENO, "Duplicate assignment name\n", strlen("Duplicate assignment name\n"));
+                return 0;
+            }
+            if (strcmp(assignments[i].resultsPath, assignments[t].resultsPath) == 0) {
+                write(STDERR_FILENO, "Duplicate results file\n", strlen("Duplicate results file\n"));
+                return 0;
+            }
+        }
+    }
+    // check the pathes of every test and make them absolute
+    for (i = 0; i < count; i++) {
+        if (assignments[i].testCount == 0) {
+            write(STDERR_FILENO, "Assignment without tests\n", strlen("Assignment without tests\n"));
+            return 0;
+        }
+        for (t = 0; t < assignments[i].testCount; t++) {
+            strcpy(strings[0], dirName);
+            strcpy(strings[1], assignments[i].inputs[t]);
+            strcpy(strings[2], assignments[i].outputs[t]);
+            if (checkUserPathes(strings) == 0) {
+                return 0;
+            }
+            strcpy(assignments[i].inputs[t], strings[1]);
+            strcpy(assignments[i].outputs[t], strings[2]);
+        }
+    }
+    if (count > 0) {
+        strcpy(dirName, strings[0]);
+    }
+    return count;
+}
+
+/**
+ * Adds the content of a file to a FNV-1a hash.
+ *
+ * @param hash The hash so far.
+ * @param filename The file to hash.
+ * @return The updated hash.
+ */
+unsigned long long hashFile(unsigned long long hash, char *filename) {
+    char buf[4096];
+    int n, i;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("Error in: open");
+        exit(-1);
+    }
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < n; i++) {
+            hash = (hash ^ (unsigned char)buf[i]) * 1099511628211ULL;
+        }
+    }
+    if (close(fd) == -1) {
+        perror("Error in: close");
+    }
+    return hash;
+}
+
+/**
+ * Computes a FNV-1a hash of the config file, the submissions directory and the
+ * content of every test input and expected output, used to tell whether a
+ * journal belongs to the same batch.
+ *
+ * @param filename The config file.
+ * @param dirName The absolute submissions directory.
+ * @param assignments The assignments of the batch.
+ * @param count The number of assignments.
+ * @return The batch identifier.
+ */
+unsigned long long batchId(char *filename, char *dirName, Assignment *assignments, int count) {
+    unsigned long long hash = hashFile(14695981039346656037ULL, filename);
+    int i, t;
+    for (i = 0; dirName[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)dirName[i]) * 1099511628211ULL;
+    }
+    for (i = 0; i < count; i++) {
+        for (t = 0; t < assignments[i].testCount; t++) {
+            hash = hashFile(hash, assignments[i].inputs[t]);
+            hash = hashFile(hash, assignments[i].outputs[t]);
+        }
+    }
+    return hash;
+}
+
+/**
+ * Orders journal entries by assignment and submission name.
+ */
+int compareJournalEntries(const void *a, const void *b) {
+    const JournalEntry *x = a;
+    const JournalEntry *y = b;
+    if (x->assignment != y->assignment) {
+        return x->assignment - y->assignment;
+    }
+    return strcmp(x->submission, y->submission);
+}
+
+/**
+ * Parses the records of a journal read into memory. A trailing line without
+ * a newline (a write cut by a crash) is ignored.
+ *
+ * @param content The journal content, after the header line.
+ * @param size The length of content.
+ * @return The number of bytes of complete lines.
+ */
+int loadJournalEntries(char *content, int size) {
+    char submission[MAX_NAME_LENGTH], verdictName[MAX_LINE_LENGTH];
+    int offset = 0, capacity = 0, assignment, v;
+    long long sourceTime, sourceSize;
+    char *end;
+    while (offset < size && (end = memchr(content + offset, '\n', size - offset)) != NULL) {
+        *end = '\0';
+        if (sscanf(content + offset, "%d\t%255[^\t]\t%199s\t%lld\t%lld", &assignment, submission, verdictName,
+                   &sourceTime, &sourceSize) == 5) {
+            for (v = NO_C_FILE; v <= SIMILAR && strcmp(verdictNames[v], verdictName) != 0; v++);
+            if (v <= SIMILAR) {
+                if (journal.count == capacity) {
+                    capacity = capacity == 0 ? 64 : capacity * 2;
+                    JournalEntry *entries = realloc(journal.entries, capacity * sizeof(JournalEntry));
+                    if (entries == NULL) {
+                        perror("Error in: realloc");
+                        exit(-1);
+                    }
+                    journal.entries = entries;
+                }
+                journal.entries[journal.count].assignment = assignment;
+                journal.entries[journal.count].verdict = v;
+                journal.entries[journal.count].sourceTime = sourceTime;
+                journal.entries[journal.count].sourceSize = sourceSize;
+                strcpy(journal.entries[journal.count].submission, submission);
+                journal.count++;
+            }
+        }
+        offset = end - content + 1;
+    }
+    qsort(journal.entries, journal.count, sizeof(JournalEntry), compareJournalEntries);
+    return offset;
+}
+
+/**
+ * Opens the progress journal in dirPath. If it belongs to the same batch its
+ * entries are loaded so already graded submissions are not graded again,
+ * otherwise a new journal is started.
+ *
+ * @param dirPath The absolute directory the journal is kept in.
+ * @param id The batch identifier returned by batchId().
+ */
+void openJournal(char *dirPath, unsigned long long id) {
+    char header[64];
+    int headerLen = snprintf(header, sizeof(header), "batch %016llx\n", id);
+    struct stat st;
+    snprintf(journal.path, sizeof(journal.path), "%s/%s", dirPath, JOURNAL_FILE);
+    // graded programs must not inherit the journal or the results files
+    journal.fd = open(journal.path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (journal.fd == -1 || fstat(journal.fd, &st) == -1) {
+        perror("Error in: open");
+        exit(-1);
+    }
+    if (st.st_size > headerLen) {
+        char *content = malloc(st.st_size);
+        if (content == NULL) {
+            perror("Error in: malloc");
+            exit(-1);
+        }
+        if (read(journal.fd, content, st.st_size) == st.st_size && memcmp(content, header, headerLen) == 0) {
+            // same batch: keep the complete records and drop a torn last line
+            int valid = headerLen + loadJournalEntries(content + headerLen, st.st_size - headerLen);
+            if (ftruncate(journal.fd, valid) == -1 || lseek(journal.fd, valid, SEEK_SET) == -1) {
+                perror("Error in: ftruncate");
+                exit(-1);
+            }
+            free(content);
+            char msg[MAX_LINE_LENGTH];
+            int len = snprintf(msg, sizeof(msg), "Resuming batch, %d already graded\n", journal.count);
+            write(STDOUT_FILENO, msg, len);
+            return;
+        }
+        free(content);
+    }
+    // new batch: start an empty journal
+    if (ftruncate(journal.fd, 0) == -1 || lseek(journal.fd, 0, SEEK_SET) == -1) {
+        perror("Error in: ftruncate");
+        exit(-1);
+    }
+    if (write(journal.fd, header, headerLen) != headerLen || fsync(journal.fd) == -1) {
+        perror("Error in: write");
+        exit(-1);
+    }
+}
+
+/**
+ * Looks up a submission in the journal of the interrupted run.
+ *
+ * @return The journaled verdict, or 0 if the submission was not graded yet
+ *         or its source file changed since.
+ */
+int journalVerdict(int assignment, char *submission, long long sourceTime, long long sourceSize) {
+    JournalEntry key, *found;
+    if (journal.count == 0 || strlen(submission) >= MAX_NAME_LENGTH) {
+        return 0;
+    }
+    key.assignment = assignment;
+    strcpy(key.submission, submission);
+    found = bsearch(&key, journal.entries, journal.count, sizeof(JournalEntry), compareJournalEntries);
+    if (found == NULL || found->sourceTime != sourceTime || found->sourceSize != sourceSize) {
+        return 0;
+    }
+    return found->verdict;
+}
+
+/**
+ * Flushes the journal records written since the last sync to disk.
+ */
+void syncJournal() {
+    if (journal.fd != -1 && journal.unsynced > 0) {
+        if (fdatasync(journal.fd) == -1) {
+            perror("Error in: fdatasync");
+        }
+        journal.unsynced = 0;
+    }
+}
+
+/**
+ * Appends a graded submission to the journal. Records are synced to disk
+ * every JOURNAL_SYNC_EVERY records, at exit and when the batch completes.
+ */
+void journalRecord(int assignment, char *submission, int verdict, long long sourceTime, long long sourceSize) {
+    char line[MAX_NAME_LENGTH + MAX_LINE_LENGTH];
+    int len;
+    if (verdict < NO_C_FILE || verdict > SIMILAR) {
+        return;
+    }
+    // names that would break the line format are simply graded again on resume
+    if (strlen(submission) >= MAX_NAME_LENGTH || strpbrk(submission, "\t\n") != NULL) {
+        return;
+    }
+    len = snprintf(line, sizeof(line), "%d\t%s\t%s\t%lld\t%lld\n", assignment, submission, verdictNames[verdict],
+                   sourceTime, sourceSize);
+    if (write(journal.fd, line, len) != len) {
+        perror("Error in: write");
+        return;
+    }
+    if (++journal.unsynced >= JOURNAL_SYNC_EVERY) {
+        syncJournal();
+    }
+}
+
+/**
+ * Removes the journal once every results file of the batch is on disk,
+ * so the next run starts a new batch.
+ */
+void finishJournal() {
+    if (close(journal.fd) == -1) {
+        perror("Error in: close");
+    }
+    journal.fd = -1;
+    if (remove(journal.path) != 0) {
+        perror("Error in: remove");
+    }
 }
 
 /**
@@ -196,10 +882,13 @@ int compileFile(char *fileName, int erfd) {
     }
     else {
         // Parent process - wait for child to finish
-        if (waitpid(pid, &status, 0) == -1) {
+        metrics.inFlight++;
+        if (waitChild(pid, &status) == -1) {
             perror("Error in: waitpid");   
+            metrics.inFlight--;
             return 0;
         }
+        metrics.inFlight--;
         if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
             // Compilation succeeded
             return 1;
@@ -212,13 +901,14 @@ int compileFile(char *fileName, int erfd) {
 }
 
 /**
- * Searches for a C source file with the ".c" extension in a directory and returns its name.
+ * Searches for a C source file matching a pattern in a directory and returns its name.
  *
  * @param dirName The directory to search for the C file.
  * @param fileName A pointer to a char array that will store the name of the C file found.
+ * @param pattern A shell wildcard pattern (e.g. "*.c") the file name has to match.
  * @return Returns 1 if a C file is found and its name is successfully stored in fileName, or 0 otherwise.
  */
-int findCFile(char *dirName, char *fileName) {
+int findCFile(char *dirName, char *fileName, char *pattern) {
     // try to open dir
     DIR *dir = opendir(dirName);
     if (dir == NULL) {
@@ -228,8 +918,8 @@ int findCFile(char *dirName, char *fileName) {
     struct dirent *entry;
     // run on the files in the dir
     while ((entry = readdir(dir)) != NULL) {
-        // Check if the file name ends with ".c"
-        if (strlen(entry->d_name) > 2 && strcmp(entry->d_name + strlen(entry->d_name) - 2, ".c") == 0) {
+        // Check if the file name matches the assignment source pattern
+        if (entry->d_name[0] != '.' && fnmatch(pattern, entry->d_name, 0) == 0) {
             sprintf(fileName, "%s", entry->d_name);
             if (closedir(dir) == -1) {
                 perror("Error in: closedir");
@@ -245,6 +935,32 @@ int findCFile(char *dirName, char *fileName) {
     return 0;
 }
 
+/**
+ * Finds the modification time (in nanoseconds) and size of the source file an
+ * assignment grades in a submission, so a journaled verdict is only reused
+ * while the source is unchanged. Both are 0 when there is no source file.
+ *
+ * @param dirName The submission directory.
+ * @param pattern The assignment source pattern.
+ * @param sourceTime Receives the modification time.
+ * @param sourceSize Receives the size.
+ */
+void sourceStamp(char *dirName, char *pattern, long long *sourceTime, long long *sourceSize) {
+    char fileName[MAX_LINE_LENGTH];
+    char path[MAX_LINE_LENGTH * 2];
+    struct stat st;
+    *sourceTime = 0;
+    *sourceSize = 0;
+    if (findCFile(dirName, fileName, pattern) == 0) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dirName, fileName);
+    if (stat(path, &st) == 0) {
+        *sourceTime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        *sourceSize = st.st_size;
+    }
+}
+
 /**
  * Executes an external program named b.out with input from a file and redirects its output to a file named "user.txt".
  * If the program runs for more than 5 seconds, it is terminated.
@@ -307,6 +1023,7 @@ int runBOut(char *inputPath, int erfd) {
         return -1;
     }
     else {
+        metrics.inFlight++;
         // Parent process: Close input and output files in parent process
         if (close(in_fd) == -1) {
             perror("Error in: close");
@@ -322,6 +1039,7 @@ int runBOut(char *inputPath, int erfd) {
         }
         // Wait for child process to finish
         while (waitpid(pid, &status, WNOHANG) == 0) {
+            maybeWriteMetrics();
             // Get current time
             struct timeval current_time;
             if (gettimeofday(&current_time, NULL) == -1) {
@@ -333,9 +1051,11 @@ int runBOut(char *inputPath, int erfd) {
                 if (kill(pid, SIGTERM) == -1) {
                     perror("Error in: kill");
                 }
+                metrics.inFlight--;
                 return 0;
             }
         }
+        metrics.inFlight--;
         // Check child process status
         if (WIFEXITED(status)) {
             // Child process exited normally
@@ -389,10 +1109,13 @@ int compareBetweenFiles(char *outputPath, char *compPath, int erfd) {
     }
     else {
         // Parent process Wait for child process to finish
-        if (waitpid(pid, &status, 0) == -1) {
+        metrics.inFlight++;
+        if (waitChild(pid, &status) == -1) {
             perror("Error in: waitpid");
+            metrics.inFlight--;
             return -1;
         }
+        metrics.inFlight--;
         // Check child process status
         if (WIFEXITED(status)) {
             // Child process exited normally
@@ -420,79 +1143,112 @@ void removeExtraFiles() {
 
 /**
  * Grades the C source code in the specified directory by attempting to compile it,
- *  run it with the given input file, and compare its output to the expected output file using an external
- *  comparison program. The results of the grading operation are written to the file descriptor `fd`.
+ *  run it with each input file of the assignment, and compare its output to the expected output file using an external
+ *  comparison program. When there are several tests the verdict with the lowest score is kept
+ *  (a timeout is scored like any other verdict). If running the program or the comparison
+ *  program fails, a row without a score is written and -1 is returned.
+ *  The results of the grading operation are written to the assignment results file.
  *
  * @param dirName The name of the directory containing the C source code to grade.
- * @param inputPath The path to the input file to use when running the C program.
- * @param outputPath The path to the expected output file to compare against.
- * @param fd The file descriptor of the file to write the results of the grading operation to.
+ * @param assignment The assignment to grade (source pattern, tests, scores and results file).
  * @param compPath The path to the comparison program to use when comparing the program output to the expected output.
- * @return 1 on success, -1 on fatal error.
+ * @return The verdict written to the results file, or -1 on fatal error.
  */
-int grade(char *dirName, char *inputPath, char *outputPath, int fd, char *compPath, int erfd) {
+int grade(char *dirName, Assignment *assignment, char *compPath, int erfd) {
     // search for c file if not found write to results and return
     char fileName[MAX_LINE_LENGTH];
-    if (findCFile(dirName, fileName) == 0) {
+    if (findCFile(dirName, fileName, assignment->pattern) == 0) {
         // Handle the case where no c file file was found
-        writeToFile(NO_C_FILE, fd);
-        return 1;
+        writeToFile(NO_C_FILE, assignment);
+        return NO_C_FILE;
     }
     // move to the dir and try to compile the found c file
     if (chdir(dirName) == -1) {
         perror("Error in: chdir");
         exit(-1);
     }
-    if (compileFile(fileName, erfd) == 0) {
+    double phaseStart = nowSeconds();
+    int compiled = compileFile(fileName, erfd);
+    recordPhase(PHASE_COMPILE, nowSeconds() - phaseStart);
+    if (compiled == 0) {
         // failed in compile so print to  result and return
-        writeToFile(COMPILATION_ERROR, fd);
+        writeToFile(COMPILATION_ERROR, assignment);
         if (chdir("..") == -1) {
             perror("Error in: chdir");
         }
-        return 1;
+        return COMPILATION_ERROR;
     }
-    // try to run the file and in case failed write to results
-    int runTheFile = runBOut(inputPath, erfd);
-    if (runTheFile == 0) {
-        writeToFile(TIMEOUT, fd);
-        if (chdir("..") == -1) {
-            perror("Error in: chdir");
+    int verdict = EXCELLENT, timedOut = 0, t;
+    for (t = 0; t < assignment->testCount; t++) {
+        // try to run the file and in case failed write to results
+        phaseStart = nowSeconds();
+        int runTheFile = runBOut(assignment->inputs[t], erfd);
+        recordPhase(PHASE_RUN, nowSeconds() - phaseStart);
+        int testVerdict = TIMEOUT;
+        if (runTheFile == 0) {
+            timedOut = 1;
+        }
+        else if (runTheFile == -1) {
+            // something else failed
+            writeErrorRow("RUN_ERROR", assignment);
+            removeExtraFiles();
+            if (chdir("..") == -1) {
+                perror("Error in: chdir");
+            }
+            return -1;
+        }
+        else {
+            // compare the userOutput.txt file
+            phaseStart = nowSeconds();
+            int compare = compareBetweenFiles(assignment->outputs[t], compPath, erfd);
+            recordPhase(PHASE_COMPARE, nowSeconds() - phaseStart);
+            testVerdict = compare + 3;
+            if (testVerdict < EXCELLENT || testVerdict > SIMILAR) {
+                // the compare program failed, this is not a score
+                writeErrorRow("COMPARE_ERROR", assignment);
+                removeExtraFiles();
+                if (chdir("..") == -1) {
+                    perror("Error in: chdir");
+                }
+                return -1;
+            }
+        }
+        if (assignment->scores[testVerdict] < assignment->scores[verdict]) {
+            verdict = testVerdict;
         }
-        return 1;
     }
-    else if (runTheFile == -1) {
-        // something else failed
-        return -1;
+    writeToFile(verdict, assignment);
+    if (!timedOut) {
+        removeExtraFiles();
     }
-    // compare the userOutput.txt file
-    int compare = compareBetweenFiles(outputPath, compPath, erfd);
-    writeToFile(compare + 3, fd);
-    removeExtraFiles();
     if (chdir("..") == -1) {
         perror("Error in: chdir");
         exit(-1);
     }
-    return 1;
+    return verdict;
 }
 
 /**
- * Searches the directory specified in `strings[0]` for subdirectories,
- * and runs the `grade()` function on each subdirectory that is found.
+ * Searches the submissions directory for subdirectories, and runs the `grade()`
+ * function of every assignment on each subdirectory that is found, so a single
+ * scan of the tree serves the whole batch.
  *
- * @param strings An array of strings containing the directory path to search in (`strings[0]`),
- *           the path of the file to input (`strings[1]`),
- *           and the name of the file containing the compare to (`strings[2]`).
+ * @param dirName The directory path to search in.
+ * @param assignments The assignments to grade; each one gets its own results file.
+ * @param count The number of assignments.
  * @param compPath A string containing the path to the file comp.out.
  * @return 0 on success, or a non-zero value on error.
  *
  */
-int fillResults(char strings[3][MAX_LINE_LENGTH], char *compPath) {
-    // open results.csv and save file descreptor
-    char *filename = "results.csv";
-    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-    if (fd == -1) {
-        perror("Error in: open");
-        exit(-1);
+int fillResults(char *dirName, Assignment *assignments, int count, char *compPath) {
+    int i;
+    // open the results file of every assignment and save file descreptors
+    for (i = 0; i < count; i++) {
+        assignments[i].fd = open(assignments[i].resultsPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (assignments[i].fd == -1) {
+            perror("Error in: open");
+            exit(-1);
+        }
     }
     char *filenameEr = "errors.txt";
     int erfd = open(filenameEr, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
@@ -502,7 +1258,7 @@ int fillResults(char strings[3][MAX_LINE_LENGTH], char *compPath) {
     }
     
     // change dir to the wanted dir and try open it
-    chdir(strings[0]);
+    chdir(dirName);
     DIR *dir = opendir(".");
     if (dir == NULL) {
         perror("Error in: opendir");
@@ -510,29 +1266,64 @@ int fillResults(char strings[3][MAX_LINE_LENGTH], char *compPath) {
     }
     // search for dirs in this dir and for each sub dir run grade function
     struct dirent *dp;
+    struct stat st;
+    // count the submissions first so the metrics can report what is pending
+    while ((dp = readdir(dir)) != NULL) {
+        if (dp->d_name[0] != '.' && stat(dp->d_name, &st) == 0 && S_ISDIR(st.st_mode)) {
+            metrics.total += count;
+        }
+    }
+    rewinddir(dir);
+    writeMetrics();
     // printf("\nprinting only directories:\n");
     while ((dp = readdir(dir)) != NULL) {
-        struct stat st;
         if (stat(dp->d_name, &st) == -1) {
             perror("Error in: stat");
             exit(-1);
         }
         if (S_ISDIR(st.st_mode) && dp->d_name[0] != '.') {
-            write(fd, dp->d_name, strlen(dp->d_name));
-            // here run grade on each dir.
-            int dirGrade = grade(dp->d_name, strings[1], strings[2], fd, compPath, erfd);
+            // here run grade of each assignment on each dir.
+            for (i = 0; i < count; i++) {
+                write(assignments[i].fd, dp->d_name, strlen(dp->d_name));
+                // submissions graded before an interruption are copied from the journal
+                long long sourceTime, sourceSize;
+                sourceStamp(dp->d_name, assignments[i].pattern, &sourceTime, &sourceSize);
+                int dirGrade = journalVerdict(i, dp->d_name, sourceTime, sourceSize);
+                if (dirGrade != 0) {
+                    writeToFile(dirGrade, &assignments[i]);
+                    metrics.replayed++;
+                }
+                else {
+                    dirGrade = grade(dp->d_name, &assignments[i], compPath, erfd);
+                    if (dirGrade >= NO_C_FILE && dirGrade <= SIMILAR) {
+                        journalRecord(i, dp->d_name, dirGrade, sourceTime, sourceSize);
+                    }
+                }
+                metrics.processed++;
+                maybeWriteMetrics();
+            }
         }
     }
+    writeMetrics();
     if (closedir(dir) == -1) {
         perror("Error in: closedir");
         exit(-1);
     }
+    for (i = 0; i < count; i++) {
+        if (fsync(assignments[i].fd) == -1) {
+            perror("Error in: fsync");
+        }
+        if (close(assignments[i].fd) == -1) {
+            perror("Error in: close");
+        }
+    }
+    finishJournal();
     return 0;
 }
 
 /**
  * The main function of the program. Parses command-line arguments,
- *  reads input data from a file, and grades the source code in the student
+ *  reads the assignments from a config file, and grades the source code in the student
  *  directories found in the current working directory.
  *
  * @param argc The number of command-line arguments.
@@ -550,19 +1341,23 @@ int main(int argc, char *argv[]) {
         perror("Error in: snprintf");
         return -1;
     }
+    initMetrics(cwd);
     // check if there is error in param
     if (argc != 2) {
         perror("Not inough param");
         exit(1);
     }
-    char strings[3][MAX_LINE_LENGTH];
-    // assign the lines from the file in strings
-    read_file(argv[1], strings);
-    // check if the file didnt contained correct pathes
-    if (checkUserPathes(strings) == 0) {
+    static Assignment assignments[MAX_ASSIGNMENTS];
+    char dirName[MAX_LINE_LENGTH];
+    // read the assignments from the config file, check if it didnt contained correct pathes
+    int count = loadConfig(argv[1], dirName, assignments, cwd);
+    if (count == 0) {
         exit(-1);
     }
+    // resume from the journal of an interrupted run of the same batch
+    openJournal(cwd, batchId(argv[1], dirName, assignments, count));
+    atexit(syncJournal);
     // fill the result
-    fillResults(strings, compPath);
+    fillResults(dirName, assignments, count, compPath);
     return 0;
 }